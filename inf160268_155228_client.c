@@ -0,0 +1,538 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ipc.h>
+#include <sys/msg.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "inf160268_155228_client.h"
+
+#define MSG_BUFFER_SIZE QN_MSG_BUFFER_SIZE
+#define TYPE_CONSUMER 200
+#define ACTION_ACK 300
+#define ACTION_NACK 400
+#define ACTION_SUBSCRIBE 500
+#define ACTION_UNSUBSCRIBE 555
+#define ACTION_SUBSCRIBE_LIST 550
+#define ACTION_UNSUBSCRIBE_LIST 505
+#define ACTION_NOTIFY 600
+
+#define SLOT_FREE 0
+#define SLOT_PENDING 1
+#define SLOT_DONE 2
+
+#define PACKET_CONSUMED 0   // Batch entry already handled, no callback due
+#define CLOSE_TIMEOUT_MS 1000
+
+// Structure for messages in the queue
+struct msg_packet {
+    long type;
+    char body[MSG_BUFFER_SIZE];
+    int sender_id;
+    int msg_category;
+    int notification_queue_id;
+    int action_queue_id;
+};
+
+// Control request waiting for, or holding, its reply
+struct request_slot {
+    int id;
+    int state;
+    long type;  // Request sent, which decides the replies that fit it
+    int msg_category;
+    int internal; // Sent by qn_client_close or cancelled; the reply is not handed out
+    struct qn_reply reply;
+};
+
+// Category the dispatcher acknowledged a subscription to
+struct subscription {
+    int msg_category;
+    struct subscription *next;
+};
+
+struct qn_client {
+    int client_id;
+    int dispatcher_queue_id;
+    int queue_id; // Receives both replies and notifications
+    qn_notify_cb on_notification;
+    qn_reply_cb on_reply;
+    void *user_data;
+
+    pthread_t receiver;
+    pthread_mutex_t lock;
+    pthread_cond_t reply_cond;
+    pthread_cond_t notify_cond;
+    int receiver_started;
+    int receiver_running;
+
+    // The dispatcher answers one client's requests in order, so ids are
+    // sequence numbers and every reply completes completed_id + 1
+    struct request_slot slots[QN_MAX_PENDING];
+    int next_id;
+    int completed_id;
+
+    // One entry per acknowledged subscribe, as the dispatcher keeps them
+    struct subscription *subscriptions;
+
+    struct qn_notification ring[QN_NOTIFY_RING_SIZE];
+    int ring_head;
+    int ring_count;
+    unsigned long dropped;
+
+    // Receiver thread scratch space, allocated once with the client
+    struct msg_packet batch[QN_RECV_BATCH];
+    struct qn_reply reply_batch[QN_RECV_BATCH];
+};
+
+// Helper functions
+static void *receiver_main(void *arg);
+static int send_request(struct qn_client *client, long type, int msg_category);
+static int send_request_locked(struct qn_client *client, long type, int msg_category, int internal);
+static void track_subscription(struct qn_client *client, struct request_slot *slot);
+static void deadline_after(struct timespec *deadline, int timeout_ms);
+static int reply_matches(long request_type, long reply_type);
+
+// A NACK can answer anything; otherwise each request has one reply type
+static int reply_matches(long request_type, long reply_type) {
+    if (reply_type == ACTION_NACK) {
+        return 1;
+    }
+    switch (request_type) {
+        case ACTION_SUBSCRIBE:
+        case ACTION_UNSUBSCRIBE:
+            return reply_type == ACTION_ACK;
+        case ACTION_SUBSCRIBE_LIST:
+        case ACTION_UNSUBSCRIBE_LIST:
+            return reply_type == request_type;
+        default:
+            return 0;
+    }
+}
+
+static void deadline_after(struct timespec *deadline, int timeout_ms) {
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+    deadline->tv_sec += timeout_ms / 1000;
+    deadline->tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+    if (deadline->tv_nsec >= 1000000000L) {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000L;
+    }
+}
+
+// Keep the subscription list in step with an acknowledged subscribe or unsubscribe
+static void track_subscription(struct qn_client *client, struct request_slot *slot) {
+    if (slot->type == ACTION_SUBSCRIBE) {
+        struct subscription *sub = (struct subscription *)malloc(sizeof(struct subscription));
+        if (!sub) {
+            perror("Memory allocation error for subscription");
+            return;
+        }
+        sub->msg_category = slot->msg_category;
+        sub->next = client->subscriptions;
+        client->subscriptions = sub;
+    } else if (slot->type == ACTION_UNSUBSCRIBE) {
+        struct subscription **current = &client->subscriptions;
+        while (*current) {
+            if ((*current)->msg_category == slot->msg_category) {
+                struct subscription *to_delete = *current;
+                *current = to_delete->next;
+                free(to_delete);
+                return;
+            }
+            current = &((*current)->next);
+        }
+    }
+}
+
+// Receiver thread: block for one message, drain whatever else is queued, then
+// account for the whole batch under a single lock
+static void *receiver_main(void *arg) {
+    struct qn_client *client = arg;
+    size_t packet_size = sizeof(struct msg_packet) - sizeof(long);
+
+    while (1) {
+        int count = 0;
+        if (msgrcv(client->queue_id, &client->batch[0], packet_size, 0, 0) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EIDRM && errno != EINVAL) {
+                perror("Error receiving from client queue");
+            }
+            break;
+        }
+        count++;
+        while (count < QN_RECV_BATCH &&
+               msgrcv(client->queue_id, &client->batch[count], packet_size, 0, IPC_NOWAIT) != -1) {
+            count++;
+        }
+
+        int replies = 0;
+        pthread_mutex_lock(&client->lock);
+        for (int i = 0; i < count; i++) {
+            struct msg_packet *packet = &client->batch[i];
+            packet->body[MSG_BUFFER_SIZE - 1] = '\0';
+
+            if (packet->type == ACTION_NOTIFY) {
+                if (client->on_notification) {
+                    continue;
+                }
+                if (client->ring_count == QN_NOTIFY_RING_SIZE) {
+                    client->dropped++;
+                    continue;
+                }
+                struct qn_notification *slot =
+                    &client->ring[(client->ring_head + client->ring_count) % QN_NOTIFY_RING_SIZE];
+                slot->msg_category = packet->msg_category;
+                slot->sender_id = packet->sender_id;
+                memcpy(slot->body, packet->body, MSG_BUFFER_SIZE);
+                client->ring_count++;
+                continue;
+            }
+
+            if (client->completed_id + 1 == client->next_id) {
+                fprintf(stderr, "Unexpected reply type %ld with no request in flight\n", packet->type);
+                packet->type = PACKET_CONSUMED;
+                continue;
+            }
+            // A stray message must not complete the request and shift every later reply
+            long request_type = client->slots[(client->completed_id + 1) % QN_MAX_PENDING].type;
+            if (!reply_matches(request_type, packet->type)) {
+                fprintf(stderr, "Dropping reply type %ld that does not answer request type %ld\n",
+                        packet->type, request_type);
+                packet->type = PACKET_CONSUMED;
+                continue;
+            }
+            int id = ++client->completed_id;
+            struct request_slot *request = &client->slots[id % QN_MAX_PENDING];
+            if (packet->type == ACTION_ACK) {
+                track_subscription(client, request);
+            }
+            if (request->internal) {
+                request->state = SLOT_FREE;
+                packet->type = PACKET_CONSUMED;
+                continue;
+            }
+            struct qn_reply *reply = client->on_reply ? &client->reply_batch[replies++] : &request->reply;
+            reply->request_id = id;
+            reply->status = packet->type == ACTION_NACK ? -1 : 0;
+            memcpy(reply->body, packet->body, MSG_BUFFER_SIZE);
+            request->state = client->on_reply ? SLOT_FREE : SLOT_DONE;
+        }
+        pthread_cond_broadcast(&client->reply_cond);
+        if (client->ring_count > 0) {
+            pthread_cond_broadcast(&client->notify_cond);
+        }
+        pthread_mutex_unlock(&client->lock);
+
+        // Callbacks run unlocked and in arrival order
+        if (client->on_notification || client->on_reply) {
+            int reply_index = 0;
+            for (int i = 0; i < count; i++) {
+                struct msg_packet *packet = &client->batch[i];
+                if (packet->type == ACTION_NOTIFY) {
+                    if (client->on_notification) {
+                        struct qn_notification notification;
+                        notification.msg_category = packet->msg_category;
+                        notification.sender_id = packet->sender_id;
+                        memcpy(notification.body, packet->body, MSG_BUFFER_SIZE);
+                        client->on_notification(&notification, client->user_data);
+                    }
+                } else if (packet->type != PACKET_CONSUMED && client->on_reply && reply_index < replies) {
+                    client->on_reply(&client->reply_batch[reply_index++], client->user_data);
+                }
+            }
+        }
+    }
+
+    pthread_mutex_lock(&client->lock);
+    client->receiver_running = 0;
+    pthread_cond_broadcast(&client->reply_cond);
+    pthread_cond_broadcast(&client->notify_cond);
+    pthread_mutex_unlock(&client->lock);
+    return NULL;
+}
+
+struct qn_client *qn_client_open(const char *key_file, int client_id,
+                                 qn_notify_cb on_notification, qn_reply_cb on_reply, void *user_data) {
+    key_t ipc_key;
+
+    // Generate IPC key
+    if ((ipc_key = ftok(key_file, 42)) == -1) {
+        perror("Error generating IPC key for dispatcher");
+        return NULL;
+    }
+
+    struct qn_client *client = (struct qn_client *)calloc(1, sizeof(struct qn_client));
+    if (!client) {
+        perror("Memory allocation error for client");
+        return NULL;
+    }
+    client->client_id = client_id;
+    client->on_notification = on_notification;
+    client->on_reply = on_reply;
+    client->user_data = user_data;
+    client->next_id = 1;
+    client->completed_id = 0;
+
+    // Connect to dispatcher queue
+    if ((client->dispatcher_queue_id = msgget(ipc_key, 0666)) == -1) {
+        perror("Error connecting to dispatcher queue");
+        free(client);
+        return NULL;
+    }
+
+    // Private client queue: the dispatcher learns its id from our packets, and a
+    // fresh queue never holds replies left over from an earlier run
+    if ((client->queue_id = msgget(IPC_PRIVATE, 0666 | IPC_CREAT)) == -1) {
+        perror("Error creating client queue");
+        free(client);
+        return NULL;
+    }
+
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    pthread_mutex_init(&client->lock, NULL);
+    pthread_cond_init(&client->reply_cond, &cond_attr);
+    pthread_cond_init(&client->notify_cond, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+
+    // Register client
+    struct msg_packet registration_packet;
+    memset(&registration_packet, 0, sizeof(registration_packet));
+    registration_packet.type = TYPE_CONSUMER;
+    registration_packet.sender_id = client_id;
+    registration_packet.notification_queue_id = client->queue_id;
+    registration_packet.action_queue_id = client->queue_id;
+
+    if (msgsnd(client->dispatcher_queue_id, &registration_packet, sizeof(registration_packet) - sizeof(long), 0) == -1) {
+        perror("Error registering client");
+        qn_client_close(client);
+        return NULL;
+    }
+
+    client->receiver_running = 1;
+    if (pthread_create(&client->receiver, NULL, receiver_main, client) != 0) {
+        fprintf(stderr, "Error starting receiver thread\n");
+        client->receiver_running = 0;
+        qn_client_close(client);
+        return NULL;
+    }
+    client->receiver_started = 1;
+
+    return client;
+}
+
+void qn_client_close(struct qn_client *client) {
+    if (!client) {
+        return;
+    }
+
+    if (client->receiver_started) {
+        // Unsubscribe first, so the dispatcher stops sending to a queue about to disappear
+        struct timespec deadline;
+        deadline_after(&deadline, CLOSE_TIMEOUT_MS);
+
+        pthread_mutex_lock(&client->lock);
+        struct subscription *subs = client->subscriptions;
+        client->subscriptions = NULL;
+        while (subs && client->receiver_running) {
+            if (send_request_locked(client, ACTION_UNSUBSCRIBE, subs->msg_category, 1) == -1) {
+                // All slots in flight: wait for replies to free one
+                if (errno != EAGAIN ||
+                    pthread_cond_timedwait(&client->reply_cond, &client->lock, &deadline) == ETIMEDOUT) {
+                    fprintf(stderr, "Error unsubscribing from category %d on close\n", subs->msg_category);
+                    break;
+                }
+                continue;
+            }
+            struct subscription *sent = subs;
+            subs = subs->next;
+            free(sent);
+        }
+        while (client->completed_id + 1 < client->next_id && client->receiver_running) {
+            if (pthread_cond_timedwait(&client->reply_cond, &client->lock, &deadline) == ETIMEDOUT) {
+                break;
+            }
+        }
+        pthread_mutex_unlock(&client->lock);
+
+        while (subs) {
+            struct subscription *next = subs->next;
+            free(subs);
+            subs = next;
+        }
+    }
+
+    // Removing the queue wakes the receiver out of msgrcv with EIDRM
+    msgctl(client->queue_id, IPC_RMID, NULL);
+
+    if (client->receiver_started) {
+        pthread_join(client->receiver, NULL);
+    }
+
+    while (client->subscriptions) {
+        struct subscription *next = client->subscriptions->next;
+        free(client->subscriptions);
+        client->subscriptions = next;
+    }
+    pthread_cond_destroy(&client->reply_cond);
+    pthread_cond_destroy(&client->notify_cond);
+    pthread_mutex_destroy(&client->lock);
+    free(client);
+}
+
+// Queue one control request without waiting for the dispatcher
+static int send_request(struct qn_client *client, long type, int msg_category) {
+    // Held across msgsnd so that ids follow the order requests reach the dispatcher
+    pthread_mutex_lock(&client->lock);
+    int id = send_request_locked(client, type, msg_category, 0);
+    int saved_errno = errno;
+    pthread_mutex_unlock(&client->lock);
+    errno = saved_errno;
+    return id;
+}
+
+static int send_request_locked(struct qn_client *client, long type, int msg_category, int internal) {
+    struct msg_packet request;
+    memset(&request, 0, sizeof(request));
+    request.type = type;
+    request.sender_id = client->client_id;
+    request.msg_category = msg_category;
+    request.notification_queue_id = client->queue_id;
+    request.action_queue_id = client->queue_id;
+
+    int id = client->next_id;
+    struct request_slot *slot = &client->slots[id % QN_MAX_PENDING];
+    if (!client->receiver_running) {
+        errno = EPIPE;
+        return -1;
+    }
+    if (slot->state != SLOT_FREE) {
+        errno = EAGAIN;
+        return -1;
+    }
+    if (msgsnd(client->dispatcher_queue_id, &request, sizeof(request) - sizeof(long), IPC_NOWAIT) == -1) {
+        return -1;
+    }
+    slot->id = id;
+    slot->type = type;
+    slot->msg_category = msg_category;
+    slot->internal = internal;
+    slot->state = SLOT_PENDING;
+    client->next_id++;
+    return id;
+}
+
+int qn_client_subscribe(struct qn_client *client, int msg_category) {
+    return send_request(client, ACTION_SUBSCRIBE, msg_category);
+}
+
+int qn_client_unsubscribe(struct qn_client *client, int msg_category) {
+    return send_request(client, ACTION_UNSUBSCRIBE, msg_category);
+}
+
+int qn_client_request_list(struct qn_client *client) {
+    return send_request(client, ACTION_SUBSCRIBE_LIST, 0);
+}
+
+int qn_client_request_subscribed(struct qn_client *client) {
+    return send_request(client, ACTION_UNSUBSCRIBE_LIST, 0);
+}
+
+int qn_client_wait_reply(struct qn_client *client, int request_id, struct qn_reply *reply, int timeout_ms) {
+    struct timespec deadline;
+    if (timeout_ms >= 0) {
+        deadline_after(&deadline, timeout_ms);
+    }
+
+    pthread_mutex_lock(&client->lock);
+    struct request_slot *slot = &client->slots[request_id % QN_MAX_PENDING];
+    if (client->on_reply || request_id <= 0 || slot->id != request_id || slot->state == SLOT_FREE ||
+        slot->internal) {
+        pthread_mutex_unlock(&client->lock);
+        errno = EINVAL;
+        return -1;
+    }
+
+    while (slot->id == request_id && slot->state == SLOT_PENDING && !slot->internal) {
+        if (!client->receiver_running) {
+            pthread_mutex_unlock(&client->lock);
+            errno = EPIPE;
+            return -1;
+        }
+        if (timeout_ms < 0) {
+            pthread_cond_wait(&client->reply_cond, &client->lock);
+        } else if (pthread_cond_timedwait(&client->reply_cond, &client->lock, &deadline) == ETIMEDOUT &&
+                   slot->state == SLOT_PENDING) {
+            pthread_mutex_unlock(&client->lock);
+            errno = ETIMEDOUT;
+            return -1;
+        }
+    }
+
+    // Cancelled by another thread while we waited
+    if (slot->internal || slot->id != request_id || slot->state != SLOT_DONE) {
+        pthread_mutex_unlock(&client->lock);
+        errno = EINVAL;
+        return -1;
+    }
+    *reply = slot->reply;
+    slot->state = SLOT_FREE;
+    pthread_mutex_unlock(&client->lock);
+    return 0;
+}
+
+int qn_client_cancel(struct qn_client *client, int request_id) {
+    pthread_mutex_lock(&client->lock);
+    struct request_slot *slot = &client->slots[request_id % QN_MAX_PENDING];
+    if (request_id <= 0 || slot->id != request_id || slot->state == SLOT_FREE || slot->internal) {
+        pthread_mutex_unlock(&client->lock);
+        errno = EINVAL;
+        return -1;
+    }
+    if (slot->state == SLOT_DONE) {
+        slot->state = SLOT_FREE;
+    } else {
+        // The receiver frees internal slots without handing the reply out
+        slot->internal = 1;
+    }
+    pthread_cond_broadcast(&client->reply_cond);
+    pthread_mutex_unlock(&client->lock);
+    return 0;
+}
+
+int qn_client_poll(struct qn_client *client, struct qn_notification *buffer, int max, int timeout_ms) {
+    struct timespec deadline;
+    if (timeout_ms > 0) {
+        deadline_after(&deadline, timeout_ms);
+    }
+
+    pthread_mutex_lock(&client->lock);
+    while (client->ring_count == 0 && timeout_ms != 0 && client->receiver_running) {
+        if (timeout_ms < 0) {
+            pthread_cond_wait(&client->notify_cond, &client->lock);
+        } else if (pthread_cond_timedwait(&client->notify_cond, &client->lock, &deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+
+    int copied = 0;
+    while (copied < max && client->ring_count > 0) {
+        buffer[copied++] = client->ring[client->ring_head];
+        client->ring_head = (client->ring_head + 1) % QN_NOTIFY_RING_SIZE;
+        client->ring_count--;
+    }
+    pthread_mutex_unlock(&client->lock);
+    return copied;
+}
+
+unsigned long qn_client_dropped(struct qn_client *client) {
+    pthread_mutex_lock(&client->lock);
+    unsigned long dropped = client->dropped;
+    pthread_mutex_unlock(&client->lock);
+    return dropped;
+}
@@ -0,0 +1,76 @@
+#ifndef INF160268_155228_CLIENT_H
+#define INF160268_155228_CLIENT_H
+
+#define QN_MSG_BUFFER_SIZE 512
+#define QN_MAX_PENDING 32      // Control requests in flight per client
+#define QN_NOTIFY_RING_SIZE 256 // Notifications buffered for qn_client_poll
+#define QN_RECV_BATCH 32       // Messages drained from the queue per wakeup
+
+// Notification delivered to the application
+struct qn_notification {
+    int msg_category;
+    int sender_id;
+    char body[QN_MSG_BUFFER_SIZE];
+};
+
+// Dispatcher reply to a control request
+struct qn_reply {
+    int request_id;
+    int status; // 0 when the dispatcher acknowledged, -1 when it rejected
+    char body[QN_MSG_BUFFER_SIZE];
+};
+
+// Callbacks run on the receiver thread and may issue new requests. They must
+// not call qn_client_wait_reply or qn_client_close: both wait for the
+// receiver thread, which is busy running the callback.
+typedef void (*qn_notify_cb)(const struct qn_notification *notification, void *user_data);
+typedef void (*qn_reply_cb)(const struct qn_reply *reply, void *user_data);
+
+struct qn_client;
+
+// Register with the dispatcher behind key_file and start the receiver thread.
+// client_id identifies the client to the dispatcher; its queue is private.
+// Without on_notification, notifications are buffered for qn_client_poll;
+// without on_reply, replies are kept for qn_client_wait_reply.
+struct qn_client *qn_client_open(const char *key_file, int client_id,
+                                 qn_notify_cb on_notification, qn_reply_cb on_reply, void *user_data);
+
+// Unsubscribe from every category the dispatcher acknowledged, wait briefly
+// for the answers, then stop the receiver thread and remove the client queue.
+// Joins the receiver thread, so it must not be called from a callback.
+void qn_client_close(struct qn_client *client);
+
+// Non-blocking control requests. Each returns a request id (> 0), or -1 with
+// errno set to EAGAIN when QN_MAX_PENDING requests are already in flight or
+// the dispatcher queue is full, EPIPE when the receiver thread has stopped,
+// or another msgsnd error (EIDRM, EINVAL) when the dispatcher queue is gone.
+// Replies complete in request order.
+//
+// Without on_reply, each id holds one of the QN_MAX_PENDING slots until it is
+// collected with qn_client_wait_reply or released with qn_client_cancel.
+// Ids left behind eventually make every request, including the unsubscribes
+// sent by qn_client_close, fail with EAGAIN.
+int qn_client_subscribe(struct qn_client *client, int msg_category);
+int qn_client_unsubscribe(struct qn_client *client, int msg_category);
+int qn_client_request_list(struct qn_client *client);
+int qn_client_request_subscribed(struct qn_client *client);
+
+// Wait for the reply to request_id and release its slot. timeout_ms < 0 waits
+// forever. Returns 0, or -1 with errno ETIMEDOUT (the slot stays held),
+// EPIPE when the receiver thread stopped first, or EINVAL when the id is
+// unknown, already collected, or the client has on_reply.
+int qn_client_wait_reply(struct qn_client *client, int request_id, struct qn_reply *reply, int timeout_ms);
+
+// Give up on request_id: a reply already received is discarded, one still
+// pending is discarded on arrival and its slot freed then. A request whose
+// reply never arrives keeps its slot. Returns 0, or -1 with errno EINVAL.
+int qn_client_cancel(struct qn_client *client, int request_id);
+
+// Copy up to max buffered notifications into buffer. timeout_ms < 0 waits
+// forever, 0 returns at once. Returns the number copied.
+int qn_client_poll(struct qn_client *client, struct qn_notification *buffer, int max, int timeout_ms);
+
+// Notifications discarded because the poll buffer was full
+unsigned long qn_client_dropped(struct qn_client *client);
+
+#endif
@@ -167,6 +167,7 @@ int client_is_subscriber(int id) {
             count++;
             break;
         }
+        current = current->next;
     }
     return count;
 }
@@ -234,7 +235,7 @@ int main(int argc, char *argv[]) {
                     response.type = ACTION_ACK;
                     snprintf(response.body, MSG_BUFFER_SIZE, "Producer registered successfully.");
                 }
-                if (msgsnd(dispatcher_queue_id, &response, sizeof(response) - sizeof(long), 0) == -1) {
+                if (msgsnd(packet.action_queue_id, &response, sizeof(response) - sizeof(long), 0) == -1) {
                     perror("Error sending producer acknowledgment");
                 }
                 break;
@@ -0,0 +1,1076 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ipc.h>
+#include <sys/msg.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+
+#define MSG_BUFFER_SIZE 512
+#define TYPE_CONSUMER 200
+#define ACTION_ACK 300
+#define ACTION_NACK 400
+#define ACTION_SUBSCRIBE 500
+#define ACTION_UNSUBSCRIBE 555
+#define ACTION_SUBSCRIBE_LIST 550
+#define ACTION_NOTIFY 600
+
+#define MAX_DISPATCHERS 16
+#define MAX_EVENTS 64
+#define NOTIFY_BATCH 64
+#define LINE_BUFFER_SIZE 1024
+#define REPLY_BUFFER_SIZE (MAX_DISPATCHERS * (MSG_BUFFER_SIZE + 64))
+#define SUBSCRIBED_LINE_SIZE 32 // Fits "Category: <int>\n" and the header/END lines
+#define REQUEST_TIMEOUT_MS 2000
+
+#define SOURCE_NOTIFICATIONS -1
+
+#define COMMAND_NONE 0
+#define COMMAND_SUBSCRIBE 1
+#define COMMAND_LIST 2
+
+// Structure for messages in the queue
+struct msg_packet {
+    long type;
+    char body[MSG_BUFFER_SIZE];
+    int sender_id;
+    int msg_category;
+    int notification_queue_id;
+    int action_queue_id;
+};
+
+// Packet handed from a receiver process to the event loop. source is the
+// dispatcher index for replies or SOURCE_NOTIFICATIONS.
+struct forwarded_packet {
+    int source;
+    int generation;
+    struct msg_packet packet;
+};
+
+// Control request sent to a dispatcher and not answered yet
+struct pending_request {
+    long type;
+    struct category *cat;       // Subscription being set up, for ACTION_SUBSCRIBE
+    struct connection *conn;    // Client waiting for the list, NULL once it is gone
+    long deadline_ms;
+    struct pending_request *next;
+};
+
+// Dispatcher this gateway is registered with. Each one answers on its own
+// reply queue, in the order it received the requests.
+struct dispatcher_link {
+    const char *key_file;
+    int queue_id;
+    int reply_queue_id;
+    int generation;             // Bumped whenever the reply queue is replaced
+    struct pending_request *pending_head;
+    struct pending_request *pending_tail;
+};
+
+// Category the gateway is subscribed to, shared by all its socket clients
+struct category {
+    int msg_category;
+    int refcount;               // Connections subscribed through the gateway
+    int outstanding;            // Dispatcher replies still expected for the subscription
+    int accepted;
+    struct category *next;
+};
+
+struct connection_sub {
+    int msg_category;
+    struct connection_sub *next;
+};
+
+// Socket client connected to the gateway. While a command waits for
+// dispatchers, the rest of the client's input stays unread behind it.
+struct connection {
+    int fd;
+    char in[LINE_BUFFER_SIZE];
+    size_t in_len;
+    struct connection_sub *subs;
+    int command;
+    int command_category;
+    int outstanding;
+    char *list_reply;
+    int reading;
+    int resume;
+    int closing;
+    struct connection *next;
+};
+
+// Global state
+struct dispatcher_link dispatchers[MAX_DISPATCHERS];
+int dispatcher_count = 0;
+int gateway_id;
+int notification_queue_id = -1;
+struct category *category_list = NULL;
+struct connection *connection_list = NULL;
+int listen_fd = -1;
+int epoll_fd = -1;
+int notify_pipe[2] = {-1, -1};
+volatile sig_atomic_t running = 1;
+
+// Helper functions
+int open_listener(const char *address);
+long now_ms(void);
+pid_t start_receiver(int queue_id, int source, int generation);
+void reset_reply_queue(int index);
+int dispatcher_send(int index, long type, int msg_category, struct category *cat, struct connection *conn);
+void complete_request(struct pending_request *request, struct msg_packet *reply);
+void handle_reply(int index, struct msg_packet *reply);
+void expire_requests(void);
+int has_pending_requests(void);
+int next_timeout(void);
+struct category *find_category(int msg_category);
+void remove_category(struct category *cat);
+void finish_category(struct category *cat);
+void release_category(int msg_category);
+void finish_list(struct connection *conn);
+void accept_connections(void);
+void close_connection(struct connection *conn);
+void update_interest(struct connection *conn);
+void sweep_connections(void);
+int process_lines(struct connection *conn);
+int handle_connection_input(struct connection *conn);
+int handle_command(struct connection *conn, char *line);
+int send_reply(struct connection *conn, const char *text);
+int connection_is_subscribed(struct connection *conn, int msg_category);
+void add_connection_sub(struct connection *conn, int msg_category);
+size_t escape_body(char *dst, const char *body);
+void fan_out(struct msg_packet **packets, int count);
+
+void handle_signal(int sig) {
+    (void)sig;
+    running = 0;
+}
+
+// Create a non-blocking listening socket from "tcp:<host>:<port>" or "unix:<path>"
+int open_listener(const char *address) {
+    int fd;
+
+    if (strncmp(address, "unix:", 5) == 0) {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (strlen(address + 5) >= sizeof(addr.sun_path)) {
+            fprintf(stderr, "Unix socket path too long: %s\n", address + 5);
+            return -1;
+        }
+        strcpy(addr.sun_path, address + 5);
+        unlink(addr.sun_path);
+
+        if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1) {
+            perror("Error creating unix socket");
+            return -1;
+        }
+        if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+            perror("Error binding unix socket");
+            close(fd);
+            return -1;
+        }
+    } else if (strncmp(address, "tcp:", 4) == 0) {
+        char host[256];
+        const char *port = strrchr(address + 4, ':');
+        if (port == NULL || (size_t)(port - (address + 4)) >= sizeof(host)) {
+            fprintf(stderr, "Invalid TCP address: %s\n", address);
+            return -1;
+        }
+        memcpy(host, address + 4, port - (address + 4));
+        host[port - (address + 4)] = '\0';
+        port++;
+
+        struct addrinfo hints, *result;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE;
+        int rc = getaddrinfo(host[0] ? host : NULL, port, &hints, &result);
+        if (rc != 0) {
+            fprintf(stderr, "Error resolving %s: %s\n", address, gai_strerror(rc));
+            return -1;
+        }
+
+        if ((fd = socket(result->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1) {
+            perror("Error creating TCP socket");
+            freeaddrinfo(result);
+            return -1;
+        }
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (bind(fd, result->ai_addr, result->ai_addrlen) == -1) {
+            perror("Error binding TCP socket");
+            freeaddrinfo(result);
+            close(fd);
+            return -1;
+        }
+        freeaddrinfo(result);
+    } else {
+        fprintf(stderr, "Listen address must be tcp:<host>:<port> or unix:<path>\n");
+        return -1;
+    }
+
+    if (listen(fd, SOMAXCONN) == -1) {
+        perror("Error listening on socket");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+long now_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000L + now.tv_nsec / 1000000L;
+}
+
+// Fork a process that blocks on queue_id and hands every packet to the event loop through the pipe
+pid_t start_receiver(int queue_id, int source, int generation) {
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("Error forking receiver");
+        return -1;
+    }
+    if (pid > 0) {
+        return pid;
+    }
+
+    // Keep only the pipe, so clients the parent closes are not held open here
+    close(notify_pipe[0]);
+    close(listen_fd);
+    close(epoll_fd);
+    for (struct connection *conn = connection_list; conn; conn = conn->next) {
+        close(conn->fd);
+    }
+
+    struct forwarded_packet forwarded;
+    forwarded.source = source;
+    forwarded.generation = generation;
+    while (1) {
+        if (msgrcv(queue_id, &forwarded.packet, sizeof(forwarded.packet) - sizeof(long), 0, 0) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EIDRM && errno != EINVAL) {
+                perror("Error receiving from gateway queue");
+            }
+            break;
+        }
+        // A forwarded packet is smaller than PIPE_BUF, so each write lands in the pipe whole
+        if (write(notify_pipe[1], &forwarded, sizeof(forwarded)) != sizeof(forwarded)) {
+            break;
+        }
+    }
+    _exit(EXIT_SUCCESS);
+}
+
+// Move a dispatcher's replies to a fresh queue; late answers to the old one are lost with it
+void reset_reply_queue(int index) {
+    struct dispatcher_link *link = &dispatchers[index];
+
+    if (link->reply_queue_id != -1) {
+        msgctl(link->reply_queue_id, IPC_RMID, NULL);
+    }
+    link->generation++;
+    if ((link->reply_queue_id = msgget(IPC_PRIVATE, 0666 | IPC_CREAT)) == -1) {
+        perror("Error creating dispatcher reply queue");
+        return;
+    }
+    start_receiver(link->reply_queue_id, index, link->generation);
+}
+
+// Queue a request at a dispatcher without waiting; the reply is matched by order
+int dispatcher_send(int index, long type, int msg_category, struct category *cat, struct connection *conn) {
+    struct dispatcher_link *link = &dispatchers[index];
+    if (link->reply_queue_id == -1) {
+        return -1;
+    }
+
+    struct msg_packet request;
+    memset(&request, 0, sizeof(request));
+    request.type = type;
+    request.sender_id = gateway_id;
+    request.msg_category = msg_category;
+    request.notification_queue_id = notification_queue_id;
+    request.action_queue_id = link->reply_queue_id;
+
+    if (msgsnd(link->queue_id, &request, sizeof(request) - sizeof(long), IPC_NOWAIT) == -1) {
+        fprintf(stderr, "Error sending request to dispatcher %s: %s\n", link->key_file, strerror(errno));
+        return -1;
+    }
+
+    struct pending_request *pending = (struct pending_request *)malloc(sizeof(struct pending_request));
+    if (!pending) {
+        perror("Memory allocation error for pending request");
+        exit(EXIT_FAILURE);
+    }
+    pending->type = type;
+    pending->cat = cat;
+    pending->conn = conn;
+    pending->deadline_ms = now_ms() + REQUEST_TIMEOUT_MS;
+    pending->next = NULL;
+    if (link->pending_tail) {
+        link->pending_tail->next = pending;
+    } else {
+        link->pending_head = pending;
+    }
+    link->pending_tail = pending;
+    return 0;
+}
+
+// Account for one dispatcher answer; reply is NULL when the request failed or timed out
+void complete_request(struct pending_request *request, struct msg_packet *reply) {
+    int ok = reply != NULL && reply->type != ACTION_NACK;
+
+    switch (request->type) {
+        case ACTION_SUBSCRIBE:
+            request->cat->outstanding--;
+            if (ok) {
+                request->cat->accepted++;
+            }
+            if (request->cat->outstanding == 0) {
+                finish_category(request->cat);
+            }
+            break;
+
+        case ACTION_SUBSCRIBE_LIST:
+            if (request->conn) {
+                if (ok) {
+                    reply->body[MSG_BUFFER_SIZE - 1] = '\0';
+                    strncat(request->conn->list_reply, reply->body,
+                            REPLY_BUFFER_SIZE - strlen(request->conn->list_reply) - 1);
+                }
+                if (--request->conn->outstanding == 0) {
+                    finish_list(request->conn);
+                }
+            }
+            break;
+
+        default:
+            break;
+    }
+    free(request);
+}
+
+// Match a reply to the oldest request still waiting at that dispatcher
+void handle_reply(int index, struct msg_packet *reply) {
+    struct dispatcher_link *link = &dispatchers[index];
+    struct pending_request *request = link->pending_head;
+    if (!request) {
+        fprintf(stderr, "Unexpected reply type %ld from dispatcher %s\n", reply->type, link->key_file);
+        return;
+    }
+    link->pending_head = request->next;
+    if (!link->pending_head) {
+        link->pending_tail = NULL;
+    }
+
+    long expected = request->type == ACTION_SUBSCRIBE_LIST ? ACTION_SUBSCRIBE_LIST : ACTION_ACK;
+    if (reply->type != expected && reply->type != ACTION_NACK) {
+        fprintf(stderr, "Reply type %ld from dispatcher %s does not match request %ld\n",
+                reply->type, link->key_file, request->type);
+        complete_request(request, NULL);
+        return;
+    }
+    complete_request(request, reply);
+}
+
+// Fail everything queued at a dispatcher whose oldest request went unanswered
+void expire_requests(void) {
+    long now = now_ms();
+    for (int i = 0; i < dispatcher_count; i++) {
+        struct dispatcher_link *link = &dispatchers[i];
+        if (!link->pending_head || link->pending_head->deadline_ms > now) {
+            continue;
+        }
+        fprintf(stderr, "Dispatcher %s did not answer within %d ms\n", link->key_file, REQUEST_TIMEOUT_MS);
+
+        struct pending_request *expired = link->pending_head;
+        link->pending_head = NULL;
+        link->pending_tail = NULL;
+        reset_reply_queue(i);
+        while (expired) {
+            struct pending_request *next = expired->next;
+            complete_request(expired, NULL);
+            expired = next;
+        }
+    }
+}
+
+// Milliseconds until the oldest pending request expires, or -1 when nothing is pending
+int next_timeout(void) {
+    long now = now_ms();
+    long timeout = -1;
+    for (int i = 0; i < dispatcher_count; i++) {
+        if (dispatchers[i].pending_head) {
+            long remaining = dispatchers[i].pending_head->deadline_ms - now;
+            if (remaining < 0) {
+                remaining = 0;
+            }
+            if (timeout == -1 || remaining < timeout) {
+                timeout = remaining;
+            }
+        }
+    }
+    return (int)timeout;
+}
+
+struct category *find_category(int msg_category) {
+    struct category *current = category_list;
+    while (current) {
+        if (current->msg_category == msg_category) {
+            return current;
+        }
+        current = current->next;
+    }
+    return NULL;
+}
+
+void remove_category(struct category *cat) {
+    struct category **current = &category_list;
+    while (*current) {
+        if (*current == cat) {
+            *current = cat->next;
+            free(cat);
+            return;
+        }
+        current = &((*current)->next);
+    }
+}
+
+// Every dispatcher answered the subscription: reply to the clients waiting for it
+void finish_category(struct category *cat) {
+    struct connection *conn = connection_list;
+    while (conn) {
+        if (conn->command == COMMAND_SUBSCRIBE && conn->command_category == cat->msg_category) {
+            char reply[64];
+            if (cat->accepted > 0) {
+                add_connection_sub(conn, cat->msg_category);
+                cat->refcount++;
+                snprintf(reply, sizeof(reply), "ACK subscribe %d\n", cat->msg_category);
+            } else {
+                snprintf(reply, sizeof(reply), "NACK subscribe %d\n", cat->msg_category);
+            }
+            conn->command = COMMAND_NONE;
+            conn->resume = 1;
+            if (send_reply(conn, reply) == -1) {
+                conn->closing = 1;
+            }
+        }
+        conn = conn->next;
+    }
+
+    if (cat->accepted > 0 && cat->refcount > 0) {
+        printf("Gateway subscribed to category %d at %d dispatcher(s)\n", cat->msg_category, cat->accepted);
+        return;
+    }
+    // Nobody is left to receive it
+    if (cat->accepted > 0) {
+        for (int i = 0; i < dispatcher_count; i++) {
+            dispatcher_send(i, ACTION_UNSUBSCRIBE, cat->msg_category, NULL, NULL);
+        }
+    }
+    remove_category(cat);
+}
+
+// Drop a reference on a category, unsubscribing at every dispatcher on the last one
+void release_category(int msg_category) {
+    struct category *cat = find_category(msg_category);
+    if (!cat || --cat->refcount > 0) {
+        return;
+    }
+    for (int i = 0; i < dispatcher_count; i++) {
+        dispatcher_send(i, ACTION_UNSUBSCRIBE, msg_category, NULL, NULL);
+    }
+    remove_category(cat);
+    printf("Gateway unsubscribed from category %d\n", msg_category);
+}
+
+// Every dispatcher answered the list request
+void finish_list(struct connection *conn) {
+    strncat(conn->list_reply, "END\n", REPLY_BUFFER_SIZE - strlen(conn->list_reply) - 1);
+    if (send_reply(conn, conn->list_reply) == -1) {
+        conn->closing = 1;
+    }
+    free(conn->list_reply);
+    conn->list_reply = NULL;
+    conn->command = COMMAND_NONE;
+    conn->resume = 1;
+}
+
+void accept_connections(void) {
+    while (1) {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                perror("Error accepting connection");
+            }
+            return;
+        }
+
+        struct connection *conn = (struct connection *)calloc(1, sizeof(struct connection));
+        if (!conn) {
+            perror("Memory allocation error for connection");
+            exit(EXIT_FAILURE);
+        }
+        conn->fd = fd;
+        conn->reading = 1;
+
+        struct epoll_event event;
+        event.events = EPOLLIN | EPOLLRDHUP;
+        event.data.ptr = conn;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+            perror("Error adding connection to epoll");
+            close(fd);
+            free(conn);
+            continue;
+        }
+
+        conn->next = connection_list;
+        connection_list = conn;
+        printf("Accepted connection %d\n", fd);
+    }
+}
+
+// Release a connection together with its share of the gateway subscriptions
+void close_connection(struct connection *conn) {
+    struct connection **current = &connection_list;
+    while (*current && *current != conn) {
+        current = &((*current)->next);
+    }
+    if (*current) {
+        *current = conn->next;
+    }
+
+    // Answers still on their way for this client are dropped when they arrive
+    for (int i = 0; i < dispatcher_count; i++) {
+        for (struct pending_request *request = dispatchers[i].pending_head; request; request = request->next) {
+            if (request->conn == conn) {
+                request->conn = NULL;
+            }
+        }
+    }
+
+    while (conn->subs) {
+        struct connection_sub *sub = conn->subs;
+        conn->subs = sub->next;
+        release_category(sub->msg_category);
+        free(sub);
+    }
+
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    printf("Closed connection %d\n", conn->fd);
+    free(conn->list_reply);
+    free(conn);
+}
+
+// Stop reading from a client while its command waits for dispatchers
+void update_interest(struct connection *conn) {
+    int reading = conn->command == COMMAND_NONE;
+    if (reading == conn->reading) {
+        return;
+    }
+    struct epoll_event event;
+    event.events = reading ? EPOLLIN | EPOLLRDHUP : 0;
+    event.data.ptr = conn;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn->fd, &event);
+    conn->reading = reading;
+}
+
+// Run input held back behind finished commands and close connections marked for it
+void sweep_connections(void) {
+    struct connection *conn = connection_list;
+    while (conn) {
+        struct connection *next = conn->next;
+        if (conn->resume && !conn->closing) {
+            conn->resume = 0;
+            if (process_lines(conn) == -1) {
+                conn->closing = 1;
+            } else {
+                update_interest(conn);
+            }
+        }
+        if (conn->closing) {
+            close_connection(conn);
+        }
+        conn = next;
+    }
+}
+
+// Write a whole reply; a client that cannot take it right away is dropped
+int send_reply(struct connection *conn, const char *text) {
+    size_t len = strlen(text);
+    ssize_t written = send(conn->fd, text, len, MSG_NOSIGNAL);
+    return written == (ssize_t)len ? 0 : -1;
+}
+
+int connection_is_subscribed(struct connection *conn, int msg_category) {
+    struct connection_sub *current = conn->subs;
+    while (current) {
+        if (current->msg_category == msg_category) {
+            return 1;
+        }
+        current = current->next;
+    }
+    return 0;
+}
+
+void add_connection_sub(struct connection *conn, int msg_category) {
+    struct connection_sub *sub = (struct connection_sub *)malloc(sizeof(struct connection_sub));
+    if (!sub) {
+        perror("Memory allocation error for connection subscription");
+        exit(EXIT_FAILURE);
+    }
+    sub->msg_category = msg_category;
+    sub->next = conn->subs;
+    conn->subs = sub;
+}
+
+// Execute one protocol line; returns -1 when the connection should be closed.
+// Commands that need dispatchers set conn->command and reply when the answers arrive.
+int handle_command(struct connection *conn, char *line) {
+    char reply[256];
+    char command[32];
+    int msg_category;
+
+    line[strcspn(line, "\r")] = '\0';
+    if (line[0] == '\0') {
+        return 0;
+    }
+
+    if (sscanf(line, "%31s %d", command, &msg_category) == 2 && strcmp(command, "subscribe") == 0) {
+        if (connection_is_subscribed(conn, msg_category)) {
+            snprintf(reply, sizeof(reply), "ACK subscribe %d\n", msg_category);
+            return send_reply(conn, reply);
+        }
+
+        struct category *cat = find_category(msg_category);
+        if (cat && cat->outstanding == 0) {
+            add_connection_sub(conn, msg_category);
+            cat->refcount++;
+            snprintf(reply, sizeof(reply), "ACK subscribe %d\n", msg_category);
+            return send_reply(conn, reply);
+        }
+
+        // Wait for the subscription in progress, or start one
+        conn->command = COMMAND_SUBSCRIBE;
+        conn->command_category = msg_category;
+        if (!cat) {
+            cat = (struct category *)calloc(1, sizeof(struct category));
+            if (!cat) {
+                perror("Memory allocation error for category");
+                exit(EXIT_FAILURE);
+            }
+            cat->msg_category = msg_category;
+            cat->next = category_list;
+            category_list = cat;
+            for (int i = 0; i < dispatcher_count; i++) {
+                if (dispatcher_send(i, ACTION_SUBSCRIBE, msg_category, cat, NULL) == 0) {
+                    cat->outstanding++;
+                }
+            }
+            if (cat->outstanding == 0) {
+                finish_category(cat);
+            }
+        }
+        return 0;
+    } else if (sscanf(line, "%31s %d", command, &msg_category) == 2 && strcmp(command, "unsubscribe") == 0) {
+        struct connection_sub **current = &conn->subs;
+        while (*current && (*current)->msg_category != msg_category) {
+            current = &((*current)->next);
+        }
+        if (*current == NULL) {
+            snprintf(reply, sizeof(reply), "NACK unsubscribe %d\n", msg_category);
+        } else {
+            struct connection_sub *to_delete = *current;
+            *current = to_delete->next;
+            free(to_delete);
+            release_category(msg_category);
+            snprintf(reply, sizeof(reply), "ACK unsubscribe %d\n", msg_category);
+        }
+    } else if (strcmp(line, "list") == 0) {
+        // Available categories, merged from every federated dispatcher
+        conn->list_reply = (char *)malloc(REPLY_BUFFER_SIZE);
+        if (!conn->list_reply) {
+            perror("Memory allocation error for list reply");
+            exit(EXIT_FAILURE);
+        }
+        snprintf(conn->list_reply, REPLY_BUFFER_SIZE, "LIST\n");
+        conn->command = COMMAND_LIST;
+        conn->outstanding = 0;
+        for (int i = 0; i < dispatcher_count; i++) {
+            if (dispatcher_send(i, ACTION_SUBSCRIBE_LIST, 0, NULL, conn) == 0) {
+                conn->outstanding++;
+            }
+        }
+        if (conn->outstanding == 0) {
+            finish_list(conn);
+        }
+        return 0;
+    } else if (strcmp(line, "subscribed") == 0) {
+        // The gateway tracks per-connection subscriptions itself; the block
+        // is sized from their number so END is never cut off
+        size_t count = 0;
+        struct connection_sub *current;
+        for (current = conn->subs; current; current = current->next) {
+            count++;
+        }
+        size_t size = (count + 2) * SUBSCRIBED_LINE_SIZE;
+        char *block = (char *)malloc(size);
+        if (!block) {
+            perror("Memory allocation error for subscribed reply");
+            exit(EXIT_FAILURE);
+        }
+        size_t len = snprintf(block, size, "SUBSCRIBED\n");
+        for (current = conn->subs; current; current = current->next) {
+            len += snprintf(block + len, size - len, "Category: %d\n", current->msg_category);
+        }
+        snprintf(block + len, size - len, "END\n");
+        int rc = send_reply(conn, block);
+        free(block);
+        return rc;
+    } else if (strcmp(line, "quit") == 0) {
+        return -1;
+    } else {
+        snprintf(reply, sizeof(reply), "NACK unknown command\n");
+    }
+
+    return send_reply(conn, reply);
+}
+
+// Run complete lines until one of them has to wait for dispatchers
+int process_lines(struct connection *conn) {
+    char *newline;
+    while (conn->command == COMMAND_NONE && (newline = memchr(conn->in, '\n', conn->in_len)) != NULL) {
+        size_t consumed = newline - conn->in + 1;
+        *newline = '\0';
+        int rc = handle_command(conn, conn->in);
+        conn->in_len -= consumed;
+        memmove(conn->in, conn->in + consumed, conn->in_len);
+        if (rc == -1) {
+            return -1;
+        }
+    }
+    if (conn->command == COMMAND_NONE && conn->in_len == sizeof(conn->in)) {
+        fprintf(stderr, "Connection %d sent an overlong line\n", conn->fd);
+        return -1;
+    }
+    return 0;
+}
+
+// Read what the client sent and run every complete line
+int handle_connection_input(struct connection *conn) {
+    while (conn->command == COMMAND_NONE) {
+        ssize_t received = recv(conn->fd, conn->in + conn->in_len, sizeof(conn->in) - conn->in_len, 0);
+        if (received == 0) {
+            return -1;
+        }
+        if (received == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        conn->in_len += received;
+        if (process_lines(conn) == -1) {
+            return -1;
+        }
+    }
+    update_interest(conn);
+    return 0;
+}
+
+// Escape a message body so it stays on one protocol line; dst needs 2 * MSG_BUFFER_SIZE bytes
+size_t escape_body(char *dst, const char *body) {
+    size_t len = 0;
+    for (size_t i = 0; i < MSG_BUFFER_SIZE && body[i] != '\0'; i++) {
+        switch (body[i]) {
+            case '\\':
+                dst[len++] = '\\';
+                dst[len++] = '\\';
+                break;
+            case '\n':
+                dst[len++] = '\\';
+                dst[len++] = 'n';
+                break;
+            case '\r':
+                dst[len++] = '\\';
+                dst[len++] = 'r';
+                break;
+            default:
+                dst[len++] = body[i];
+        }
+    }
+    return len;
+}
+
+// Format each notification once, then hand every connection its share in a single writev
+void fan_out(struct msg_packet **packets, int count) {
+    char prefixes[NOTIFY_BATCH][32];
+    static char bodies[NOTIFY_BATCH][2 * MSG_BUFFER_SIZE];
+    size_t prefix_len[NOTIFY_BATCH];
+    size_t body_len[NOTIFY_BATCH];
+    static char newline = '\n';
+
+    if (count == 0) {
+        return;
+    }
+    for (int i = 0; i < count; i++) {
+        prefix_len[i] = snprintf(prefixes[i], sizeof(prefixes[i]), "NOTIFY %d ", packets[i]->msg_category);
+        body_len[i] = escape_body(bodies[i], packets[i]->body);
+    }
+
+    for (struct connection *conn = connection_list; conn; conn = conn->next) {
+        struct iovec iov[NOTIFY_BATCH * 3];
+        int iov_count = 0;
+        size_t total = 0;
+
+        if (conn->closing) {
+            continue;
+        }
+        for (int i = 0; i < count; i++) {
+            if (packets[i]->type != ACTION_NOTIFY || !connection_is_subscribed(conn, packets[i]->msg_category)) {
+                continue;
+            }
+            iov[iov_count].iov_base = prefixes[i];
+            iov[iov_count++].iov_len = prefix_len[i];
+            iov[iov_count].iov_base = bodies[i];
+            iov[iov_count++].iov_len = body_len[i];
+            iov[iov_count].iov_base = &newline;
+            iov[iov_count++].iov_len = 1;
+            total += prefix_len[i] + body_len[i] + 1;
+        }
+
+        if (iov_count > 0) {
+            ssize_t written = writev(conn->fd, iov, iov_count);
+            if (written != (ssize_t)total) {
+                // Slow or gone; a partial frame cannot be resumed, so the client is dropped
+                fprintf(stderr, "Dropping connection %d: could not deliver notifications\n", conn->fd);
+                conn->closing = 1;
+            }
+        }
+    }
+}
+
+int has_pending_requests(void) {
+    for (int i = 0; i < dispatcher_count; i++) {
+        if (dispatchers[i].pending_head) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 4) {
+        fprintf(stderr, "Usage: %s <tcp:host:port|unix:path> <gateway_id> <key_file> [key_file...]\n", argv[0]);
+        fprintf(stderr, "gateway_id must not be used by any other client or gateway of these dispatchers:\n"
+                        "they tell subscriptions apart only by id, so an unsubscribe under the same id\n"
+                        "can remove the gateway's subscription and cut off its socket clients.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    gateway_id = atoi(argv[2]);
+    if (argc - 3 > MAX_DISPATCHERS) {
+        fprintf(stderr, "At most %d dispatchers can be federated\n", MAX_DISPATCHERS);
+        exit(EXIT_FAILURE);
+    }
+
+    // Connect to every dispatcher queue
+    for (int i = 3; i < argc; i++) {
+        key_t ipc_key;
+        if ((ipc_key = ftok(argv[i], 42)) == -1) {
+            perror("Error generating IPC key for dispatcher");
+            exit(EXIT_FAILURE);
+        }
+        dispatchers[dispatcher_count].key_file = argv[i];
+        dispatchers[dispatcher_count].reply_queue_id = -1;
+        if ((dispatchers[dispatcher_count].queue_id = msgget(ipc_key, 0666)) == -1) {
+            perror("Error connecting to dispatcher queue");
+            exit(EXIT_FAILURE);
+        }
+        dispatcher_count++;
+    }
+
+    if ((listen_fd = open_listener(argv[1])) == -1) {
+        exit(EXIT_FAILURE);
+    }
+
+    // Private queues: every dispatcher on the host delivers into the same notification
+    // queue, and answers control requests on a reply queue of its own
+    if ((notification_queue_id = msgget(IPC_PRIVATE, 0666 | IPC_CREAT)) == -1) {
+        perror("Error creating gateway notifications queue");
+        exit(EXIT_FAILURE);
+    }
+
+    if (pipe2(notify_pipe, O_CLOEXEC) == -1) {
+        perror("Error creating receiver pipe");
+        msgctl(notification_queue_id, IPC_RMID, NULL);
+        exit(EXIT_FAILURE);
+    }
+
+    pid_t notification_receiver = start_receiver(notification_queue_id, SOURCE_NOTIFICATIONS, 0);
+    if (notification_receiver == -1) {
+        msgctl(notification_queue_id, IPC_RMID, NULL);
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < dispatcher_count; i++) {
+        reset_reply_queue(i);
+    }
+
+    // Register the gateway as a regular consumer
+    for (int i = 0; i < dispatcher_count; i++) {
+        struct msg_packet registration_packet;
+        memset(&registration_packet, 0, sizeof(registration_packet));
+        registration_packet.type = TYPE_CONSUMER;
+        registration_packet.sender_id = gateway_id;
+        registration_packet.notification_queue_id = notification_queue_id;
+        registration_packet.action_queue_id = dispatchers[i].reply_queue_id;
+        if (msgsnd(dispatchers[i].queue_id, &registration_packet, sizeof(registration_packet) - sizeof(long), IPC_NOWAIT) == -1) {
+            fprintf(stderr, "Error registering gateway with dispatcher %s: %s\n", dispatchers[i].key_file, strerror(errno));
+        }
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    if ((epoll_fd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+        perror("Error creating epoll instance");
+        exit(EXIT_FAILURE);
+    }
+
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = &listen_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event);
+    event.events = EPOLLIN;
+    event.data.ptr = &notify_pipe[0];
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, notify_pipe[0], &event);
+
+    printf("Gateway %d listening on %s for %d dispatcher(s).\n", gateway_id, argv[1], dispatcher_count);
+
+    struct forwarded_packet packets[NOTIFY_BATCH];
+    size_t buffered = 0;
+    struct epoll_event events[MAX_EVENTS];
+    int draining = 0;
+    long drain_deadline = 0;
+
+    while (1) {
+        if (!running && !draining) {
+            // Stop taking clients, then give the unsubscribes time to be answered
+            printf("Gateway shutting down.\n");
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, listen_fd, NULL);
+            while (connection_list) {
+                close_connection(connection_list);
+            }
+            draining = 1;
+            drain_deadline = now_ms() + REQUEST_TIMEOUT_MS;
+        }
+        if (draining && (!has_pending_requests() || now_ms() >= drain_deadline)) {
+            break;
+        }
+
+        int ready = epoll_wait(epoll_fd, events, MAX_EVENTS, next_timeout());
+        if (ready == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Error waiting for events");
+            break;
+        }
+
+        for (int i = 0; i < ready; i++) {
+            if (events[i].data.ptr == &listen_fd) {
+                accept_connections();
+            } else if (events[i].data.ptr == &notify_pipe[0]) {
+                // Drain a batch of forwarded packets in one read
+                ssize_t received = read(notify_pipe[0], (char *)packets + buffered, sizeof(packets) - buffered);
+                if (received <= 0) {
+                    continue;
+                }
+                buffered += received;
+                int count = buffered / sizeof(struct forwarded_packet);
+
+                // Deliver notifications and replies in the order they arrived
+                struct msg_packet *notifications[NOTIFY_BATCH];
+                int notification_count = 0;
+                for (int j = 0; j < count; j++) {
+                    struct forwarded_packet *forwarded = &packets[j];
+                    if (forwarded->source == SOURCE_NOTIFICATIONS) {
+                        notifications[notification_count++] = &forwarded->packet;
+                        continue;
+                    }
+                    fan_out(notifications, notification_count);
+                    notification_count = 0;
+                    if (forwarded->source >= 0 && forwarded->source < dispatcher_count &&
+                        forwarded->generation == dispatchers[forwarded->source].generation) {
+                        handle_reply(forwarded->source, &forwarded->packet);
+                    }
+                }
+                fan_out(notifications, notification_count);
+
+                buffered -= count * sizeof(struct forwarded_packet);
+                memmove(packets, (char *)packets + count * sizeof(struct forwarded_packet), buffered);
+            } else {
+                struct connection *conn = events[i].data.ptr;
+                if (conn->closing) {
+                    continue;
+                }
+                if ((events[i].events & (EPOLLERR | EPOLLHUP)) || handle_connection_input(conn) == -1) {
+                    conn->closing = 1;
+                }
+            }
+        }
+
+        expire_requests();
+        sweep_connections();
+
+        pid_t exited;
+        while ((exited = waitpid(-1, NULL, WNOHANG)) > 0) {
+            if (exited == notification_receiver) {
+                fprintf(stderr, "Notification receiver exited. Shutting down.\n");
+                running = 0;
+            }
+        }
+    }
+
+    while (connection_list) {
+        close_connection(connection_list);
+    }
+
+    // Removing the queues stops the receivers
+    msgctl(notification_queue_id, IPC_RMID, NULL);
+    for (int i = 0; i < dispatcher_count; i++) {
+        msgctl(dispatchers[i].reply_queue_id, IPC_RMID, NULL);
+        while (dispatchers[i].pending_head) {
+            struct pending_request *next = dispatchers[i].pending_head->next;
+            free(dispatchers[i].pending_head);
+            dispatchers[i].pending_head = next;
+        }
+    }
+    while (wait(NULL) > 0) {
+    }
+    close(listen_fd);
+    if (strncmp(argv[1], "unix:", 5) == 0) {
+        unlink(argv[1] + 5);
+    }
+
+    return 0;
+}
@@ -28,7 +28,7 @@ int main(int argc, char *argv[]) {
     }
 
     key_t ipc_key;
-    int dispatcher_queue_id;
+    int dispatcher_queue_id, reply_queue_id;
     int producer_id = atoi(argv[2]);
     int message_category = atoi(argv[3]);
 
@@ -44,25 +44,34 @@ int main(int argc, char *argv[]) {
         exit(EXIT_FAILURE);
     }
 
+    // Private queue for the dispatcher's answer, so the dispatcher cannot read it back itself
+    if ((reply_queue_id = msgget(IPC_PRIVATE, 0666 | IPC_CREAT)) == -1) {
+        perror("Error creating reply queue");
+        exit(EXIT_FAILURE);
+    }
+
     // Register producer
     struct msg_packet registration_packet;
     registration_packet.type = TYPE_PRODUCER;
     registration_packet.sender_id = producer_id;
     registration_packet.msg_category = message_category;
     registration_packet.notification_queue_id = producer_id;
-    registration_packet.action_queue_id = producer_id;
+    registration_packet.action_queue_id = reply_queue_id;
 
     if (msgsnd(dispatcher_queue_id, &registration_packet, sizeof(registration_packet) - sizeof(long), 0) == -1) {
         perror("Error sending registration packet");
+        msgctl(reply_queue_id, IPC_RMID, NULL);
         exit(EXIT_FAILURE);
     }
 
     // Wait for acknowledgment
     struct msg_packet response_packet;
-    if (msgrcv(dispatcher_queue_id, &response_packet, sizeof(response_packet) - sizeof(long), 0, 0) == -1) {
+    if (msgrcv(reply_queue_id, &response_packet, sizeof(response_packet) - sizeof(long), 0, 0) == -1) {
         perror("Error receiving acknowledgment");
+        msgctl(reply_queue_id, IPC_RMID, NULL);
         exit(EXIT_FAILURE);
     }
+    msgctl(reply_queue_id, IPC_RMID, NULL);
 
     if (response_packet.type == ACTION_NACK) {
         fprintf(stderr, "Registration rejected by dispatcher: %s\n", response_packet.body);
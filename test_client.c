@@ -0,0 +1,340 @@
+// Local check of the client library against one dispatcher, driven by
+// test_client.py. Each case prints "ok: <case>"; the first failed check
+// prints "FAIL: ..." and exits with status 1.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ipc.h>
+#include <sys/msg.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "inf160268_155228_client.h"
+
+#define MSG_BUFFER_SIZE QN_MSG_BUFFER_SIZE
+#define TYPE_PRODUCER 100
+#define ACTION_ACK 300
+#define ACTION_NOTIFY 600
+
+#define REPLY_TIMEOUT_MS 2000
+#define EXTRA_NOTIFICATIONS 20
+
+// Structure for messages in the queue
+struct msg_packet {
+    long type;
+    char body[MSG_BUFFER_SIZE];
+    int sender_id;
+    int msg_category;
+    int notification_queue_id;
+    int action_queue_id;
+};
+
+// What the callback client has seen, guarded by lock
+struct callback_state {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct qn_client *client;
+    int subscribe_id;
+    int subscribed_id;
+    int replies;
+    struct qn_reply last_reply;
+    int notifications;
+    struct qn_notification last_notification;
+};
+
+const char *key_file;
+int dispatcher_queue_id;
+
+#define CHECK(cond, ...) do { \
+    if (!(cond)) { \
+        printf("FAIL: %s:%d: ", __FILE__, __LINE__); \
+        printf(__VA_ARGS__); \
+        printf("\n"); \
+        exit(EXIT_FAILURE); \
+    } \
+} while (0)
+
+// Register a category the way the producer does, on a private reply queue
+void register_producer(int producer_id, int msg_category) {
+    int reply_queue_id = msgget(IPC_PRIVATE, 0666 | IPC_CREAT);
+    CHECK(reply_queue_id != -1, "msgget: %s", strerror(errno));
+
+    struct msg_packet packet;
+    memset(&packet, 0, sizeof(packet));
+    packet.type = TYPE_PRODUCER;
+    packet.sender_id = producer_id;
+    packet.msg_category = msg_category;
+    packet.action_queue_id = reply_queue_id;
+    CHECK(msgsnd(dispatcher_queue_id, &packet, sizeof(packet) - sizeof(long), 0) == 0, "msgsnd: %s", strerror(errno));
+    CHECK(msgrcv(reply_queue_id, &packet, sizeof(packet) - sizeof(long), 0, 0) != -1, "msgrcv: %s", strerror(errno));
+    CHECK(packet.type == ACTION_ACK, "producer %d for category %d got reply type %ld",
+          producer_id, msg_category, packet.type);
+    msgctl(reply_queue_id, IPC_RMID, NULL);
+}
+
+void send_notification(int producer_id, int msg_category, const char *body) {
+    struct msg_packet packet;
+    memset(&packet, 0, sizeof(packet));
+    packet.type = ACTION_NOTIFY;
+    packet.sender_id = producer_id;
+    packet.msg_category = msg_category;
+    snprintf(packet.body, MSG_BUFFER_SIZE, "%s", body);
+    CHECK(msgsnd(dispatcher_queue_id, &packet, sizeof(packet) - sizeof(long), 0) == 0, "msgsnd: %s", strerror(errno));
+}
+
+struct qn_client *open_client(int client_id, qn_notify_cb on_notification, qn_reply_cb on_reply, void *user_data) {
+    struct qn_client *client = qn_client_open(key_file, client_id, on_notification, on_reply, user_data);
+    CHECK(client != NULL, "qn_client_open for client %d failed", client_id);
+    return client;
+}
+
+struct qn_reply wait_reply(struct qn_client *client, int request_id) {
+    struct qn_reply reply;
+    CHECK(request_id > 0, "request failed: %s", strerror(errno));
+    CHECK(qn_client_wait_reply(client, request_id, &reply, REPLY_TIMEOUT_MS) == 0,
+          "no reply to request %d: %s", request_id, strerror(errno));
+    CHECK(reply.request_id == request_id, "reply carries id %d instead of %d", reply.request_id, request_id);
+    return reply;
+}
+
+int count_lines(const char *body, const char *line) {
+    int count = 0;
+    size_t len = strlen(line);
+    for (const char *p = body; (p = strstr(p, line)) != NULL; p += len) {
+        if ((p == body || p[-1] == '\n') && p[len] == '\n') {
+            count++;
+        }
+    }
+    return count;
+}
+
+// Pipelined requests complete out of the order they are collected in, each
+// with the reply meant for it
+void test_pipelined(struct qn_client *a) {
+    int subscribe_1 = qn_client_subscribe(a, 1);
+    int list = qn_client_request_list(a);
+    int subscribe_2 = qn_client_subscribe(a, 2);
+    int subscribe_1_again = qn_client_subscribe(a, 1);
+    int subscribed = qn_client_request_subscribed(a);
+
+    struct qn_reply reply = wait_reply(a, subscribed);
+    CHECK(reply.status == 0, "subscribed list rejected: %s", reply.body);
+    CHECK(count_lines(reply.body, "Category: 1") == 2 && count_lines(reply.body, "Category: 2") == 1,
+          "unexpected subscribed list %s", reply.body);
+    reply = wait_reply(a, subscribe_2);
+    CHECK(reply.status == 0, "subscribe 2 rejected: %s", reply.body);
+    reply = wait_reply(a, list);
+    CHECK(reply.status == 0, "list rejected: %s", reply.body);
+    CHECK(count_lines(reply.body, "ID: 101, Category: 1") == 1 && count_lines(reply.body, "ID: 102, Category: 2") == 1,
+          "unexpected list %s", reply.body);
+    reply = wait_reply(a, subscribe_1_again);
+    CHECK(reply.status == 0, "second subscribe 1 rejected: %s", reply.body);
+    reply = wait_reply(a, subscribe_1);
+    CHECK(reply.status == 0, "subscribe 1 rejected: %s", reply.body);
+
+    // A collected id cannot be collected again
+    CHECK(qn_client_wait_reply(a, subscribe_1, &reply, 0) == -1 && errno == EINVAL,
+          "collected request %d was handed out twice", subscribe_1);
+
+    // Uncollected ids hold their slots until they are cancelled
+    int held[QN_MAX_PENDING];
+    for (int i = 0; i < QN_MAX_PENDING; i++) {
+        // Before the slots run out, EAGAIN only means the dispatcher queue is full
+        for (int waited = 0; (held[i] = qn_client_request_list(a)) == -1 && errno == EAGAIN; waited += 10) {
+            CHECK(waited < REPLY_TIMEOUT_MS, "dispatcher queue stayed full");
+            usleep(10000);
+        }
+        CHECK(held[i] > 0, "request %d of %d failed: %s", i + 1, QN_MAX_PENDING, strerror(errno));
+    }
+    CHECK(qn_client_request_list(a) == -1 && errno == EAGAIN, "request past QN_MAX_PENDING accepted");
+    for (int i = 0; i < QN_MAX_PENDING; i++) {
+        CHECK(qn_client_cancel(a, held[i]) == 0, "cancel %d failed", held[i]);
+    }
+    CHECK(qn_client_cancel(a, held[0]) == -1 && errno == EINVAL, "request %d cancelled twice", held[0]);
+    CHECK(qn_client_wait_reply(a, held[0], &reply, 0) == -1 && errno == EINVAL,
+          "cancelled request %d was handed out", held[0]);
+    int next;
+    for (int waited = 0; (next = qn_client_request_subscribed(a)) == -1 && errno == EAGAIN; waited += 10) {
+        CHECK(waited < REPLY_TIMEOUT_MS, "cancelled requests kept their slots");
+        usleep(10000);
+    }
+    reply = wait_reply(a, next);
+    CHECK(reply.status == 0 && count_lines(reply.body, "Category: 2") == 1,
+          "reply to a cancelled request handed to the next one: %s", reply.body);
+    printf("ok: pipelined and cancelled requests\n");
+}
+
+// Each client only sees its own subscriptions, whichever of them the
+// dispatcher registered last
+void test_two_clients(struct qn_client *a, struct qn_client *b) {
+    struct qn_reply reply = wait_reply(b, qn_client_request_subscribed(b));
+    CHECK(reply.status == 0, "subscribed list rejected: %s", reply.body);
+    CHECK(strcmp(reply.body, "Category: 3\n") == 0, "unexpected subscribed list %s", reply.body);
+
+    reply = wait_reply(b, qn_client_subscribe(b, 5));
+    CHECK(reply.status == 0, "subscribe 5 rejected: %s", reply.body);
+    reply = wait_reply(a, qn_client_request_subscribed(a));
+    CHECK(reply.status == 0, "subscribed list rejected: %s", reply.body);
+    CHECK(count_lines(reply.body, "Category: 3") == 0 && count_lines(reply.body, "Category: 5") == 0,
+          "subscribed list of client 11 shows client 12: %s", reply.body);
+    reply = wait_reply(b, qn_client_unsubscribe(b, 5));
+    CHECK(reply.status == 0, "unsubscribe 5 rejected: %s", reply.body);
+    printf("ok: two clients on one dispatcher\n");
+}
+
+// Notifications past the ring size are counted as dropped; the rest come out
+// in order through a caller buffer
+void test_poll(struct qn_client *b) {
+    char body[MSG_BUFFER_SIZE];
+    int total = QN_NOTIFY_RING_SIZE + EXTRA_NOTIFICATIONS;
+    for (int i = 0; i < total; i++) {
+        snprintf(body, sizeof(body), "message %d", i);
+        send_notification(103, 3, body);
+    }
+
+    for (int waited = 0; qn_client_dropped(b) < EXTRA_NOTIFICATIONS; waited += 10) {
+        CHECK(waited < REPLY_TIMEOUT_MS, "only %lu notifications dropped", qn_client_dropped(b));
+        usleep(10000);
+    }
+
+    struct qn_notification buffer[100];
+    int received = 0;
+    int copied;
+    while ((copied = qn_client_poll(b, buffer, 100, 0)) > 0) {
+        CHECK(copied <= 100, "poll copied %d into a buffer of 100", copied);
+        for (int i = 0; i < copied; i++) {
+            snprintf(body, sizeof(body), "message %d", received + i);
+            CHECK(buffer[i].msg_category == 3 && strcmp(buffer[i].body, body) == 0,
+                  "expected %s, got category %d: %s", body, buffer[i].msg_category, buffer[i].body);
+        }
+        received += copied;
+    }
+    CHECK(received == QN_NOTIFY_RING_SIZE, "polled %d notifications", received);
+    CHECK(qn_client_dropped(b) == EXTRA_NOTIFICATIONS, "dropped %lu notifications", qn_client_dropped(b));
+
+    send_notification(103, 3, "after drain");
+    CHECK(qn_client_poll(b, buffer, 100, REPLY_TIMEOUT_MS) == 1 && strcmp(buffer[0].body, "after drain") == 0,
+          "notification after drain missing");
+    CHECK(qn_client_poll(b, buffer, 100, 50) == 0, "poll returned a notification nobody sent");
+    printf("ok: polling into a caller buffer with drops counted\n");
+}
+
+void on_reply(const struct qn_reply *reply, void *user_data) {
+    struct callback_state *state = user_data;
+    pthread_mutex_lock(&state->lock);
+    int subscribe_done = reply->request_id == state->subscribe_id;
+    pthread_mutex_unlock(&state->lock);
+
+    // Callbacks may issue new requests
+    int subscribed_id = subscribe_done ? qn_client_request_subscribed(state->client) : 0;
+
+    pthread_mutex_lock(&state->lock);
+    if (subscribe_done) {
+        state->subscribed_id = subscribed_id;
+    }
+    state->replies++;
+    state->last_reply = *reply;
+    pthread_cond_broadcast(&state->cond);
+    pthread_mutex_unlock(&state->lock);
+}
+
+void on_notification(const struct qn_notification *notification, void *user_data) {
+    struct callback_state *state = user_data;
+    pthread_mutex_lock(&state->lock);
+    state->notifications++;
+    state->last_notification = *notification;
+    pthread_cond_broadcast(&state->cond);
+    pthread_mutex_unlock(&state->lock);
+}
+
+void wait_for_count(struct callback_state *state, int *counter, int wanted) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += REPLY_TIMEOUT_MS / 1000;
+    while (*counter < wanted) {
+        CHECK(pthread_cond_timedwait(&state->cond, &state->lock, &deadline) != ETIMEDOUT,
+              "callback count %d, expected %d", *counter, wanted);
+    }
+}
+
+void test_callbacks(void) {
+    struct callback_state state;
+    memset(&state, 0, sizeof(state));
+    pthread_mutex_init(&state.lock, NULL);
+    pthread_cond_init(&state.cond, NULL);
+
+    pthread_mutex_lock(&state.lock);
+    state.client = open_client(13, on_notification, on_reply, &state);
+    state.subscribe_id = qn_client_subscribe(state.client, 4);
+    CHECK(state.subscribe_id > 0, "subscribe failed: %s", strerror(errno));
+
+    // The subscribe reply, then the subscribed list requested from its callback
+    wait_for_count(&state, &state.replies, 2);
+    CHECK(state.subscribed_id > 0, "request from the reply callback failed");
+    CHECK(state.last_reply.request_id == state.subscribed_id && state.last_reply.status == 0 &&
+          strcmp(state.last_reply.body, "Category: 4\n") == 0,
+          "reply %d: %s", state.last_reply.request_id, state.last_reply.body);
+    pthread_mutex_unlock(&state.lock);
+
+    struct qn_reply reply;
+    CHECK(qn_client_wait_reply(state.client, state.subscribe_id, &reply, 0) == -1 && errno == EINVAL,
+          "wait_reply worked with a reply callback");
+
+    send_notification(104, 4, "to the callback");
+    pthread_mutex_lock(&state.lock);
+    wait_for_count(&state, &state.notifications, 1);
+    CHECK(state.last_notification.msg_category == 4 && strcmp(state.last_notification.body, "to the callback") == 0,
+          "callback got category %d: %s", state.last_notification.msg_category, state.last_notification.body);
+    pthread_mutex_unlock(&state.lock);
+
+    qn_client_close(state.client);
+    pthread_cond_destroy(&state.cond);
+    pthread_mutex_destroy(&state.lock);
+    printf("ok: reply and notification callbacks\n");
+}
+
+// The dispatcher no longer lists any subscription for client_id
+void check_unsubscribed(int client_id) {
+    struct qn_client *probe = open_client(client_id, NULL, NULL, NULL);
+    struct qn_reply reply = wait_reply(probe, qn_client_request_subscribed(probe));
+    CHECK(reply.status == -1, "client %d still subscribed after close: %s", client_id, reply.body);
+    qn_client_close(probe);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <key_file>\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    key_file = argv[1];
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    key_t ipc_key = ftok(key_file, 42);
+    CHECK(ipc_key != -1, "ftok: %s", strerror(errno));
+    dispatcher_queue_id = msgget(ipc_key, 0666);
+    CHECK(dispatcher_queue_id != -1, "dispatcher queue: %s", strerror(errno));
+
+    register_producer(101, 1);
+    register_producer(102, 2);
+
+    struct qn_client *b = open_client(12, NULL, NULL, NULL);
+    struct qn_reply reply = wait_reply(b, qn_client_subscribe(b, 3));
+    CHECK(reply.status == 0, "subscribe 3 rejected: %s", reply.body);
+
+    struct qn_client *a = open_client(11, NULL, NULL, NULL);
+    test_pipelined(a);
+    test_two_clients(a, b);
+    test_poll(b);
+    test_callbacks();
+
+    // Client 11 holds category 1 twice and category 2 once
+    qn_client_close(a);
+    qn_client_close(b);
+    check_unsubscribed(11);
+    check_unsubscribed(12);
+    check_unsubscribed(13);
+    printf("ok: close unsubscribes from every category\n");
+    return 0;
+}
@@ -0,0 +1,105 @@
+#!/usr/bin/env python3
+"""Local check of the client library against a dispatcher.
+
+Builds the dispatcher and test_client.c linked with the library, starts one
+dispatcher and runs the harness against it. The harness covers pipelined
+requests, two clients on one dispatcher, polling with drops, reply and
+notification callbacks, and unsubscribing on close. Afterwards every process
+and message queue is cleaned up.
+
+Usage: python3 test_client.py
+"""
+
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+REPO = os.path.dirname(os.path.abspath(__file__))
+TIMEOUT = 30.0
+CASES = 5
+
+
+def ftok(path, proj_id):
+    st = os.stat(path)
+    return ((proj_id & 0xFF) << 24) | ((st.st_dev & 0xFF) << 16) | (st.st_ino & 0xFFFF)
+
+
+def queue_exists(key_file):
+    listing = subprocess.check_output(["ipcs", "-q"]).decode()
+    return "0x%08x" % ftok(key_file, 42) in listing
+
+
+def private_queues():
+    listing = subprocess.check_output(["ipcs", "-q"]).decode().splitlines()
+    return set(line.split()[1] for line in listing if line.startswith("0x00000000"))
+
+
+def build(workdir):
+    dispatcher = os.path.join(workdir, "dispatcher")
+    harness = os.path.join(workdir, "test_client")
+    subprocess.check_call(["gcc", "-Wall", "-O2", os.path.join(REPO, "inf160268_155228_d.c"), "-o", dispatcher])
+    subprocess.check_call(["gcc", "-Wall", "-O2", "-I", REPO, os.path.join(REPO, "test_client.c"),
+                           os.path.join(REPO, "inf160268_155228_client.c"), "-pthread", "-o", harness])
+    return dispatcher, harness
+
+
+def wait_for(predicate, what):
+    deadline = time.monotonic() + 5.0
+    while not predicate():
+        if time.monotonic() > deadline:
+            raise AssertionError("timed out waiting for " + what)
+        time.sleep(0.05)
+
+
+def run(workdir, processes, queues_before):
+    dispatcher, harness = build(workdir)
+    key_file = os.path.join(workdir, "keyfile.txt")
+    open(key_file, "w").close()
+
+    processes.append(subprocess.Popen([dispatcher, key_file], stdout=subprocess.DEVNULL))
+    wait_for(lambda: queue_exists(key_file), "dispatcher queue")
+
+    result = subprocess.run([harness, key_file], stdout=subprocess.PIPE, timeout=TIMEOUT)
+    output = result.stdout.decode()
+    sys.stdout.write(output)
+    if result.returncode != 0:
+        raise AssertionError("harness exited with status %d" % result.returncode)
+    if output.count("ok: ") != CASES:
+        raise AssertionError("harness finished %d of %d cases" % (output.count("ok: "), CASES))
+    if processes[0].poll() is not None:
+        raise AssertionError("dispatcher exited during the run")
+
+    leaked = private_queues() - queues_before
+    if leaked:
+        raise AssertionError("client queues left behind: %s" % ", ".join(sorted(leaked)))
+
+
+def main():
+    processes = []
+    queues_before = private_queues()
+    with tempfile.TemporaryDirectory() as workdir:
+        try:
+            run(workdir, processes, queues_before)
+            print("PASS: client library against a dispatcher")
+            status = 0
+        except (AssertionError, OSError, subprocess.CalledProcessError, subprocess.TimeoutExpired) as error:
+            print("FAIL: %s" % error)
+            status = 1
+        finally:
+            for process in processes:
+                if process.poll() is None:
+                    process.kill()
+                    process.wait()
+            path = os.path.join(workdir, "keyfile.txt")
+            if os.path.exists(path):
+                subprocess.call(["ipcrm", "-Q", hex(ftok(path, 42))], stderr=subprocess.DEVNULL)
+            # A failed harness exits without closing its clients
+            for queue in private_queues() - queues_before:
+                subprocess.call(["ipcrm", "-q", queue], stderr=subprocess.DEVNULL)
+    return status
+
+
+if __name__ == "__main__":
+    sys.exit(main())
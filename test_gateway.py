@@ -0,0 +1,228 @@
+#!/usr/bin/env python3
+"""Local check of the socket gateway against two federated dispatchers.
+
+Builds the dispatcher, producer and gateway, starts two dispatchers with one
+producer each, and runs a TCP gateway on loopback and a Unix-socket gateway,
+both federating the two dispatchers. Verifies the ACK, LIST, SUBSCRIBED and
+NOTIFY replies, including a SUBSCRIBED block for a connection with many
+subscriptions, then cleans up every process and message queue.
+
+Usage: python3 test_gateway.py
+"""
+
+import os
+import signal
+import socket
+import subprocess
+import sys
+import tempfile
+import time
+
+REPO = os.path.dirname(os.path.abspath(__file__))
+TIMEOUT = 5.0
+
+
+class LineClient:
+    def __init__(self, family, address):
+        self.sock = socket.socket(family, socket.SOCK_STREAM)
+        self.sock.connect(address)
+        self.sock.settimeout(TIMEOUT)
+        self.buffer = b""
+
+    def send(self, line):
+        self.sock.sendall(line.encode() + b"\n")
+
+    def read_line(self):
+        deadline = time.monotonic() + TIMEOUT
+        while b"\n" not in self.buffer:
+            if time.monotonic() > deadline:
+                raise AssertionError("timed out waiting for a line, buffered %r" % self.buffer)
+            chunk = self.sock.recv(4096)
+            if not chunk:
+                raise AssertionError("connection closed, buffered %r" % self.buffer)
+            self.buffer += chunk
+        line, self.buffer = self.buffer.split(b"\n", 1)
+        return line.decode()
+
+    def read_block(self):
+        lines = []
+        while True:
+            line = self.read_line()
+            if line == "END":
+                return lines
+            lines.append(line)
+
+    def command(self, line):
+        self.send(line)
+        return self.read_line()
+
+    def close(self):
+        self.sock.close()
+
+
+def expect(actual, wanted):
+    if actual != wanted:
+        raise AssertionError("expected %r, got %r" % (wanted, actual))
+
+
+def ftok(path, proj_id):
+    st = os.stat(path)
+    return ((proj_id & 0xFF) << 24) | ((st.st_dev & 0xFF) << 16) | (st.st_ino & 0xFFFF)
+
+
+def queue_exists(key_file):
+    listing = subprocess.check_output(["ipcs", "-q"]).decode()
+    return "0x%08x" % ftok(key_file, 42) in listing
+
+
+def build(workdir):
+    binaries = {}
+    for name, source in (("dispatcher", "d"), ("producer", "p"), ("gateway", "g")):
+        binary = os.path.join(workdir, name)
+        subprocess.check_call(["gcc", "-Wall", "-O2", os.path.join(REPO, "inf160268_155228_%s.c" % source), "-o", binary])
+        binaries[name] = binary
+    return binaries
+
+
+def free_port():
+    with socket.socket() as probe:
+        probe.bind(("127.0.0.1", 0))
+        return probe.getsockname()[1]
+
+
+def wait_for(predicate, what):
+    deadline = time.monotonic() + TIMEOUT
+    while not predicate():
+        if time.monotonic() > deadline:
+            raise AssertionError("timed out waiting for " + what)
+        time.sleep(0.05)
+
+
+def run(workdir, processes):
+    binaries = build(workdir)
+    key_files = []
+    for name in ("keyfile1.txt", "keyfile2.txt"):
+        path = os.path.join(workdir, name)
+        open(path, "w").close()
+        key_files.append(path)
+
+    def start(args, **kwargs):
+        process = subprocess.Popen(args, stdout=subprocess.DEVNULL, **kwargs)
+        processes.append(process)
+        return process
+
+    for key_file in key_files:
+        start([binaries["dispatcher"], key_file])
+    wait_for(lambda: all(queue_exists(key_file) for key_file in key_files), "dispatcher queues")
+
+    # One producer per dispatcher: category 1 on the first, category 2 on the second
+    producers = [
+        start([binaries["producer"], key_files[0], "101", "1"], stdin=subprocess.PIPE),
+        start([binaries["producer"], key_files[1], "102", "2"], stdin=subprocess.PIPE),
+    ]
+
+    port = free_port()
+    unix_path = os.path.join(workdir, "gateway.sock")
+    tcp_gateway = start([binaries["gateway"], "tcp:127.0.0.1:%d" % port, "900"] + key_files)
+    unix_gateway = start([binaries["gateway"], "unix:" + unix_path, "901"] + key_files)
+
+    def connect(family, address):
+        def attempt():
+            try:
+                attempt.client = LineClient(family, address)
+                return True
+            except OSError:
+                return False
+        wait_for(attempt, "gateway at %s" % (address,))
+        return attempt.client
+
+    tcp_client = connect(socket.AF_INET, ("127.0.0.1", port))
+    unix_client = connect(socket.AF_UNIX, unix_path)
+
+    # LIST merges the categories of both dispatchers once the producers are registered
+    def both_listed():
+        tcp_client.send("list")
+        expect(tcp_client.read_line(), "LIST")
+        listed = tcp_client.read_block()
+        return any("Category: 1" in line for line in listed) and any("Category: 2" in line for line in listed)
+    wait_for(both_listed, "both producers in LIST")
+
+    expect(tcp_client.command("subscribe 1"), "ACK subscribe 1")
+    expect(tcp_client.command("subscribe 2"), "ACK subscribe 2")
+    expect(unix_client.command("subscribe 2"), "ACK subscribe 2")
+    expect(unix_client.command("unsubscribe 1"), "NACK unsubscribe 1")
+    expect(unix_client.command("bogus"), "NACK unknown command")
+
+    tcp_client.send("subscribed")
+    expect(tcp_client.read_line(), "SUBSCRIBED")
+    expect(sorted(tcp_client.read_block()), ["Category: 1", "Category: 2"])
+
+    # SUBSCRIBED lists every subscription of a connection, however many it has
+    many = range(10, 40)
+    for msg_category in many:
+        expect(unix_client.command("subscribe %d" % msg_category), "ACK subscribe %d" % msg_category)
+    unix_client.send("subscribed")
+    expect(unix_client.read_line(), "SUBSCRIBED")
+    expect(sorted(unix_client.read_block()), sorted(["Category: %d" % c for c in list(many) + [2]]))
+    for msg_category in many:
+        expect(unix_client.command("unsubscribe %d" % msg_category), "ACK unsubscribe %d" % msg_category)
+
+    for producer, message in ((producers[0], "from dispatcher one"), (producers[1], "from dispatcher two")):
+        producer.stdin.write(message.encode() + b"\n")
+        producer.stdin.flush()
+        time.sleep(0.1)
+
+    # Notifications from both dispatchers reach the TCP client; the Unix client only sees category 2
+    expect(sorted([tcp_client.read_line(), tcp_client.read_line()]),
+           ["NOTIFY 1 from dispatcher one", "NOTIFY 2 from dispatcher two"])
+    expect(unix_client.read_line(), "NOTIFY 2 from dispatcher two")
+
+    expect(tcp_client.command("unsubscribe 2"), "ACK unsubscribe 2")
+    producers[1].stdin.write(b"after unsubscribe\n")
+    producers[1].stdin.flush()
+    expect(unix_client.read_line(), "NOTIFY 2 after unsubscribe")
+
+    tcp_client.close()
+    unix_client.close()
+    for producer in producers:
+        producer.stdin.write(b"exit\n")
+        producer.stdin.close()
+        producer.wait(TIMEOUT)
+
+    for gateway in (tcp_gateway, unix_gateway):
+        gateway.send_signal(signal.SIGTERM)
+        expect(gateway.wait(TIMEOUT), 0)
+    if os.path.exists(unix_path):
+        raise AssertionError("gateway left its socket behind")
+
+
+def main():
+    processes = []
+    with tempfile.TemporaryDirectory() as workdir:
+        try:
+            run(workdir, processes)
+            print("PASS: gateway over TCP and Unix socket with two federated dispatchers")
+            status = 0
+        except (AssertionError, OSError, subprocess.CalledProcessError, subprocess.TimeoutExpired) as error:
+            print("FAIL: %s" % error)
+            status = 1
+        finally:
+            # Newest first with SIGTERM, so gateways unsubscribe, remove their
+            # queues and reap their receivers while the dispatchers still run
+            for process in reversed(processes):
+                if process.poll() is None:
+                    process.terminate()
+                try:
+                    process.wait(TIMEOUT)
+                except subprocess.TimeoutExpired:
+                    process.kill()
+                    process.wait()
+            for name in ("keyfile1.txt", "keyfile2.txt"):
+                path = os.path.join(workdir, name)
+                if os.path.exists(path):
+                    subprocess.call(["ipcrm", "-Q", hex(ftok(path, 42))], stderr=subprocess.DEVNULL)
+    return status
+
+
+if __name__ == "__main__":
+    sys.exit(main())